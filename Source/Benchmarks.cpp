@@ -0,0 +1,203 @@
+/*
+  ==============================================================================
+
+    Benchmarks.cpp
+
+  ==============================================================================
+*/
+
+#include "Benchmarks.h"
+#include "ScopedValueSaver.h"
+
+namespace
+{
+    struct WriterThread : public Thread
+    {
+        WriterThread(ScopedValueSaver<int>& s, int firstValue, int n, WaitableEvent& go) :
+        Thread("benchmark writer"),
+        saver(s),
+        startValue(firstValue),
+        numWrites(n),
+        startSignal(go)
+        {
+        }
+        
+        void run() override
+        {
+            startSignal.wait();
+            for( int i = 0; i < numWrites; ++i )
+            {
+                saver = startValue + i;
+            }
+        }
+        
+        ScopedValueSaver<int>& saver;
+        int startValue, numWrites;
+        WaitableEvent& startSignal;
+    };
+    
+    /**
+     starts one WriterThread per saver, all released at once, and returns the time taken
+     for every one of them to finish.
+     */
+    double timeWriters(OwnedArray<ScopedValueSaver<int>>& savers, int numThreads, int writesPerThread)
+    {
+        WaitableEvent go(true);
+        OwnedArray<WriterThread> writers;
+        for( int i = 0; i < numThreads; ++i )
+        {
+            auto& saver = *savers.getUnchecked(i % savers.size());
+            writers.add(new WriterThread(saver, i * writesPerThread, writesPerThread, go));
+            writers.getLast()->startThread();
+        }
+        
+        const double startMs = Time::getMillisecondCounterHiRes();
+        go.signal();
+        for( auto* w : writers )
+        {
+            w->waitForThreadToExit(-1);
+        }
+        return Time::getMillisecondCounterHiRes() - startMs;
+    }
+    
+    PropertiesFile::Options getBenchmarkOptions(PropertiesFile::StorageFormat format)
+    {
+        PropertiesFile::Options options;
+        options.storageFormat = format;
+        options.millisecondsBeforeSaving = -1;
+        return options;
+    }
+}
+
+//==============================================================================
+void Benchmarks::run()
+{
+    concurrentWriters();
+    if( threadShouldExit() )
+        return;
+    
+    storageFormats();
+    if( threadShouldExit() )
+        return;
+    
+    JUCEApplication::quit();
+}
+
+void Benchmarks::concurrentWriters()
+{
+    const int writesPerThread = 20000;
+    
+    //no PropertyManager exists yet in the Benchmark configuration, so this one uses the temporary file
+    TemporaryFile settingsFile(".settings");
+    PropertyManager::setSettingsFileOverride(settingsFile.getFile());
+    SharedResourcePointer<PropertyManager> props;
+    PropertyManager::setSettingsFileOverride(File());
+    
+    Logger::writeToLog("concurrent writers (" + String(writesPerThread) + " writes per thread)");
+    Logger::writeToLog("threads | separate keys (writes/s) | shared key (writes/s) | file writes | last writer wins");
+    
+    for( int numThreads : { 1, 2, 4, 8 } )
+    {
+        if( threadShouldExit() )
+            break;
+        
+        OwnedArray<ScopedValueSaver<int>> separate;
+        for( int i = 0; i < numThreads; ++i )
+        {
+            separate.add(new ScopedValueSaver<int>("benchmark.thread" + String(i), 0));
+        }
+        
+        OwnedArray<ScopedValueSaver<int>> shared;
+        shared.add(new ScopedValueSaver<int>("benchmark.shared", 0));
+        
+        props->flush();
+        const int fileWritesBefore = props->getNumFileWrites();
+        
+        const double separateMs = timeWriters(separate, numThreads, writesPerThread);
+        const double sharedMs = timeWriters(shared, numThreads, writesPerThread);
+        
+        //whichever write got the newest version must be what ends up in the file
+        props->flush();
+        const String inMemory = static_cast<var>(*shared.getFirst()).toString();
+        const bool lastWriterWins = props->getValue("benchmark.shared", String()) == inMemory;
+        const int fileWrites = props->getNumFileWrites() - fileWritesBefore;
+        
+        const double totalWrites = double(numThreads) * writesPerThread;
+        Logger::writeToLog(String(numThreads).paddedLeft(' ', 7)
+                           + " | " + String(totalWrites * 1000.0 / separateMs, 0).paddedLeft(' ', 24)
+                           + " | " + String(totalWrites * 1000.0 / sharedMs, 0).paddedLeft(' ', 21)
+                           + " | " + String(fileWrites).paddedLeft(' ', 11)
+                           + " | " + (lastWriterWins ? "yes" : "NO"));
+        
+    }
+}
+
+void Benchmarks::storageFormats()
+{
+    const int numKeys = 2000;
+    const int numRepeats = 20;
+    
+    //long dotted keys and Colour::toString() values, like the real settings file
+    StringPairArray settings(false);
+    Random random(1234);
+    for( int i = 0; i < numKeys; ++i )
+    {
+        String key = "benchmark.section" + String(i / 50) + ".widget" + String(i % 50) + ".colour";
+        settings.set(key, Colour(random.nextInt()).toString());
+    }
+    
+    struct Format
+    {
+        const char* name;
+        PropertiesFile::StorageFormat format;
+    };
+    const Format formats[] =
+    {
+        { "XML", PropertiesFile::storeAsXML },
+        { "binary", PropertiesFile::storeAsBinary },
+        { "compressed binary", PropertiesFile::storeAsCompressedBinary },
+    };
+    
+    Logger::writeToLog("storage formats (" + String(numKeys) + " keys, average of " + String(numRepeats) + " runs)");
+    Logger::writeToLog("format            | size (bytes) | vs XML | save (ms) | load (ms)");
+    
+    int64 xmlSize = 0;
+    for( auto& f : formats )
+    {
+        if( threadShouldExit() )
+            return;
+        
+        TemporaryFile temp(".settings");
+        auto options = getBenchmarkOptions(f.format);
+        
+        double saveMs = 0.0;
+        for( int r = 0; r < numRepeats; ++r )
+        {
+            PropertiesFile file(temp.getFile(), options);
+            file.addAllPropertiesFrom(settings);
+            
+            const double startMs = Time::getMillisecondCounterHiRes();
+            file.save();
+            saveMs += Time::getMillisecondCounterHiRes() - startMs;
+        }
+        
+        double loadMs = 0.0;
+        for( int r = 0; r < numRepeats; ++r )
+        {
+            const double startMs = Time::getMillisecondCounterHiRes();
+            PropertiesFile file(temp.getFile(), options);
+            loadMs += Time::getMillisecondCounterHiRes() - startMs;
+            jassert( file.getAllProperties().size() == numKeys );
+        }
+        
+        const int64 size = temp.getFile().getSize();
+        if( f.format == PropertiesFile::storeAsXML )
+            xmlSize = size;
+        
+        Logger::writeToLog(String(f.name).paddedRight(' ', 17)
+                           + " | " + String(size).paddedLeft(' ', 12)
+                           + " | " + (String(100.0 * size / jmax(int64(1), xmlSize), 1) + "%").paddedLeft(' ', 6)
+                           + " | " + String(saveMs / numRepeats, 3).paddedLeft(' ', 9)
+                           + " | " + String(loadMs / numRepeats, 3).paddedLeft(' ', 9));
+    }
+}
@@ -0,0 +1,47 @@
+/*
+  ==============================================================================
+
+    Benchmarks.h
+
+  ==============================================================================
+*/
+
+#ifndef BENCHMARKS_H_INCLUDED
+#define BENCHMARKS_H_INCLUDED
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+//==============================================================================
+/**
+ Runs the ScopedValueSaver / PropertyManager benchmarks and writes the results with Logger::writeToLog().
+ 
+ These are built into the app by the "Benchmark" configuration, which defines
+ SCOPEDVALUESAVER_RUN_BENCHMARKS=1.  The app then runs them on a background thread
+ instead of opening its window, and quits when they're done.
+ 
+ The savers used by the benchmarks write to a temporary settings file, not the real one.
+ Each benchmark checks threadShouldExit() between runs, so quitting part way through doesn't hang.
+ */
+struct Benchmarks : public Thread
+{
+    Benchmarks() : Thread("Benchmarks") {}
+    ~Benchmarks() { stopThread(-1); }
+    
+    void run() override;
+    
+    /**
+     writes values from 1, 2, 4 and 8 threads at once, both to a saver per thread
+     and to a single shared saver, and reports the writes per second.
+     */
+    void concurrentWriters();
+    
+    /**
+     saves and loads the same settings as XML, binary and GZIP-compressed binary,
+     and reports the file size and load/save times of each, relative to XML.
+     */
+    void storageFormats();
+    
+    JUCE_DECLARE_NON_COPYABLE(Benchmarks)
+};
+
+#endif  // BENCHMARKS_H_INCLUDED
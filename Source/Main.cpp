@@ -10,6 +10,7 @@
 
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "MainComponent.h"
+#include "Benchmarks.h"
 
 
 //==============================================================================
@@ -28,7 +29,12 @@ public:
     {
         // This method is where you should put your application's initialisation code..
         
+       #if SCOPEDVALUESAVER_RUN_BENCHMARKS
+        benchmarks = new Benchmarks();
+        benchmarks->startThread();
+       #else
         mainWindow = new MainWindow (getApplicationName());
+       #endif
     }
 
     void shutdown() override
@@ -36,6 +42,7 @@ public:
         // Add your application's shutdown code here..
 
         mainWindow = nullptr; // (deletes our window)
+        benchmarks = nullptr;
     }
 
     //==============================================================================
@@ -93,6 +100,7 @@ public:
 
 private:
     ScopedPointer<MainWindow> mainWindow;
+    ScopedPointer<Benchmarks> benchmarks;
 };
 
 //==============================================================================
@@ -0,0 +1,198 @@
+/*
+  ==============================================================================
+
+    PropertyTrace.h
+
+  ==============================================================================
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#ifndef PROPERTYTRACE_H_INCLUDED
+#define PROPERTYTRACE_H_INCLUDED
+
+//==============================================================================
+/**
+ Records timed spans around the PropertyManager and ScopedValueSaver persistence work,
+ and writes them out in the Chrome trace event format, which can be opened with
+ chrome://tracing or ui.perfetto.dev
+
+ Tracing is off by default.  Turn it on by either:
+ setting the SCOPEDVALUESAVER_TRACE environment variable to the path of the trace file to write
+ or calling PropertyTrace::getInstance().start(file) before the first ScopedValueSaver is created.
+
+ When tracing is off, a Span only checks a single atomic flag.
+
+ Spans are buffered, and appended to the trace file every maxBufferedEvents spans and whenever
+ the PropertyManager is destroyed.  The file is a JSON array that is only closed by stop(),
+ which both trace viewers accept, so a crash only loses the spans that were still buffered.
+ */
+struct PropertyTrace
+{
+    static PropertyTrace& getInstance()
+    {
+        static PropertyTrace instance;
+        return instance;
+    }
+
+    /**
+     starts recording spans into traceFile, replacing its previous contents.
+     */
+    void start(const File& traceFile)
+    {
+        ScopedLock wl(writeLock);
+        file = traceFile;
+        file.replaceWithText("[\n");
+        isFirstEvent = true;
+        enabled = 1;
+    }
+
+    ///writes out everything recorded so far, closes the JSON array and stops recording.
+    void stop()
+    {
+        if( !isEnabled() )
+            return;
+
+        flush();
+        enabled = 0;
+
+        ScopedLock wl(writeLock);
+        file.appendText("\n]\n");
+    }
+
+    bool isEnabled() const noexcept { return enabled.get() != 0; }
+
+    /**
+     appends all buffered spans to the trace file.
+     this happens by itself every maxBufferedEvents spans, and when the PropertyManager is destroyed.
+     */
+    void flush()
+    {
+        if( !isEnabled() )
+            return;
+
+        Array<Event> toWrite;
+        {
+            ScopedLock sl(eventLock);
+            toWrite.swapWith(events);
+        }
+
+        ScopedLock wl(writeLock);
+        FileOutputStream out(file);
+        if( !out.openedOk() )
+            return;
+
+        for( auto& e : toWrite )
+        {
+            if( !isFirstEvent )
+                out << ",\n";
+
+            out << e.toJSON();
+            isFirstEvent = false;
+        }
+    }
+
+    ///how many spans are kept in memory before they're appended to the trace file
+    static constexpr int maxBufferedEvents = 1024;
+
+    //==============================================================================
+    /**
+     Times the scope it lives in.  The span is recorded when it goes out of scope.
+
+     @param name the name shown in the trace viewer.  must be a string literal, as only the pointer is kept.
+     @param key an optional property key name, shown in the span's args
+     */
+    struct Span
+    {
+        Span(const char* spanName, StringRef key = StringRef()) : name(spanName)
+        {
+            if( PropertyTrace::getInstance().isEnabled() )
+            {
+                keyName = key;
+                startMs = Time::getMillisecondCounterHiRes();
+            }
+        }
+
+        ~Span()
+        {
+            if( startMs > 0.0 )
+            {
+                PropertyTrace::getInstance().addEvent(name,
+                                                      keyName,
+                                                      startMs,
+                                                      Time::getMillisecondCounterHiRes() - startMs);
+            }
+        }
+    private:
+        const char* name;
+        String keyName;
+        double startMs = 0.0;
+
+        JUCE_DECLARE_NON_COPYABLE(Span)
+    };
+private:
+    struct Event
+    {
+        const char* name;
+        String keyName;
+        double startMs, durationMs;
+        int64 threadId;
+
+        ///a Chrome trace "complete" event: ph = X, with ts and dur in microseconds
+        String toJSON() const
+        {
+            DynamicObject::Ptr event = new DynamicObject();
+            event->setProperty("name", name);
+            event->setProperty("cat", "ScopedValueSaver");
+            event->setProperty("ph", "X");
+            event->setProperty("ts", startMs * 1000.0);
+            event->setProperty("dur", durationMs * 1000.0);
+            event->setProperty("pid", 1);
+            event->setProperty("tid", threadId);
+            if( keyName.isNotEmpty() )
+            {
+                DynamicObject::Ptr args = new DynamicObject();
+                args->setProperty("key", keyName);
+                event->setProperty("args", var(args.get()));
+            }
+            return JSON::toString(var(event.get()), true);
+        }
+    };
+
+    PropertyTrace()
+    {
+        String path = SystemStats::getEnvironmentVariable("SCOPEDVALUESAVER_TRACE", String());
+        if( path.isNotEmpty() )
+        {
+            start( File::getCurrentWorkingDirectory().getChildFile(path) );
+        }
+    }
+
+    void addEvent(const char* name, const String& keyName, double startMs, double durationMs)
+    {
+        bool bufferIsFull = false;
+        {
+            ScopedLock sl(eventLock);
+            events.add({ name, keyName, startMs, durationMs, (int64) (pointer_sized_int) Thread::getCurrentThreadId() });
+            bufferIsFull = events.size() >= maxBufferedEvents;
+        }
+
+        if( bufferIsFull )
+            flush();
+    }
+
+    Atomic<int> enabled;
+
+    ///guards events.  never held while writing to the file.
+    CriticalSection eventLock;
+    Array<Event> events;
+
+    ///guards file and isFirstEvent
+    CriticalSection writeLock;
+    File file;
+    bool isFirstEvent = true;
+
+    JUCE_DECLARE_NON_COPYABLE(PropertyTrace)
+};
+
+#endif  // PROPERTYTRACE_H_INCLUDED
@@ -9,10 +9,23 @@
 */
 
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "PropertyTrace.h"
 
 #ifndef SCOPEDVALUESAVER_H_INCLUDED
 #define SCOPEDVALUESAVER_H_INCLUDED
 
+/**
+ set this to 1 to store the settings file as GZIP-compressed binary instead of plain XML.
+ the long key names and stringified values repeat a lot, so they compress well.
+ an existing file in either format is still read correctly after switching.
+ if it was stored in the other format, the PropertyManager rewrites it in the new format
+ as soon as it is created; unchanged values alone would never cause a save.
+ The "Benchmark" configuration compares the file size and load/save times of each format.
+ */
+#ifndef SCOPEDVALUESAVER_COMPRESS_SETTINGS
+ #define SCOPEDVALUESAVER_COMPRESS_SETTINGS 0
+#endif
+
 struct PropertyManager
 {
     struct Property
@@ -25,6 +38,7 @@ struct PropertyManager
     
     PropertyManager()
     {
+        PropertyTrace::Span span("PropertyManager::PropertyManager");
         jassert( String(ProjectInfo::projectName).isNotEmpty() );
         jassert( String(ProjectInfo::companyName).isNotEmpty() );
         
@@ -33,29 +47,85 @@ struct PropertyManager
         options.filenameSuffix = ".settings";
         options.osxLibrarySubFolder = "Application Support";
         options.folderName = String(ProjectInfo::companyName) + File::separatorString + String(ProjectInfo::projectName);
+        options.millisecondsBeforeSaving = -1; //the flush thread does the saving, under fileLock
+        
+        const File overrideFile = getSettingsFileOverride();
+        if( overrideFile != File() )
+        {
+            options.applicationName = overrideFile.getFileNameWithoutExtension();
+            options.filenameSuffix = overrideFile.getFileExtension();
+            options.folderName = overrideFile.getParentDirectory().getFullPathName();
+        }
+       #if SCOPEDVALUESAVER_COMPRESS_SETTINGS
+        options.storageFormat = PropertiesFile::storeAsCompressedBinary;
+       #else
         options.storageFormat = PropertiesFile::storeAsXML;
+       #endif
+        
+        {
+            PropertyTrace::Span setStorageSpan("ApplicationProperties::setStorageParameters");
+            appProperties.setStorageParameters(options);
+        }
+        
+        PropertiesFile* settings = nullptr;
+        {
+            //the settings file is loaded and parsed the first time getUserSettings() is called
+            PropertyTrace::Span loadSpan("ApplicationProperties::getUserSettings (file load)");
+            settings = appProperties.getUserSettings();
+        }
         
-        appProperties.setStorageParameters(options);
-        auto* settings = appProperties.getUserSettings();
         if( !settings->getFile().existsAsFile() )
         {
+            PropertyTrace::Span createSpan("File::create");
             settings->getFile().create();
         }
-        settings->getFile().revealToUser();
+        else if( settings->getFile().getSize() > 0 && !isStoredAs(settings->getFile(), options.storageFormat) )
+        {
+            //SCOPEDVALUESAVER_COMPRESS_SETTINGS was switched since this file was written
+            settings->setNeedsToBeSaved(true);
+        }
+        
+        if( overrideFile == File() )
+        {
+            PropertyTrace::Span revealSpan("File::revealToUser");
+            settings->getFile().revealToUser();
+        }
+        
+        flushThread.startThread();
+        if( settings->needsToBeSaved() )
+            flushThread.notify();
     }
     
     ~PropertyManager()
     {
-        appProperties.saveIfNeeded();
+        flushThread.signalThreadShouldExit();
+        flushThread.notify();
+        flushThread.stopThread(-1); //run() always returns once signalled, and killing it mid-save would truncate the file
+        flush();
         DBG( "properties file path: " << appProperties.getUserSettings()->getFile().getFullPathName() );
+        DBG( "properties file size: " << appProperties.getUserSettings()->getFile().getSize() << " bytes" );
+        PropertyTrace::getInstance().flush();
     }
     
-    ApplicationProperties& getProperties() { return appProperties; }
+    /**
+     makes the next PropertyManager that is created use this file instead of the application's
+     settings file.  This only works while no PropertyManager exists, i.e. before the first
+     ScopedValueSaver is created or after the last one is destroyed.
+     Pass File() to go back to the application's settings file.
+     */
+    static void setSettingsFileOverride(const File& file) { getSettingsFileOverride() = file; }
     
     void dump(StringRef prefix="settings: ")
     {
+        flush();
+        ScopedLock sl(fileLock);
         DBG( prefix );
+       #if SCOPEDVALUESAVER_COMPRESS_SETTINGS
+        //the file on disk is binary, so dump the in-memory properties instead
+        DBG( appProperties.getUserSettings()->getAllProperties().getDescription() );
+       #else
         DBG( appProperties.getUserSettings()->getFile().loadFileAsString() );
+       #endif
     }
     
     /**
@@ -81,11 +151,333 @@ struct PropertyManager
         ScopedLock sl(propertyLock);
         properties.removeFirstMatchingValue(p);
     }
+    
+    /**
+     returns a new, globally increasing version number.
+     a saver grabs one of these at the moment it snapshots its value, so the order of
+     the version numbers matches the order in which the values were actually written.
+     */
+    int64 nextVersion() noexcept { return ++versionCounter; }
+    
+    /**
+     returns the lock that guards a ValueSource.  every saver that refers to the same source,
+     like a follower and the saver it follows, gets the same lock.
+     the locks are striped, so unrelated sources may also end up sharing one.
+     */
+    const CriticalSection& getValueLock(const ValueSource& source) const noexcept
+    {
+        return valueLocks[((pointer_sized_uint) &source >> 4) % numValueLocks];
+    }
+    
+    /**
+     stages a value for the settings file if its version is newer than the last version
+     published for that key.  This is a compare-and-swap on the per-key version:
+     a writer that lost the race (i.e. a newer version was already published) is dropped,
+     so the file always ends up holding the last writer's value, regardless of which thread
+     got to the file first.
+     
+     Nothing is written here.  The flush thread is woken up, and it writes every change
+     staged since its last pass in one go, so writers never wait for disk I/O.
+     
+     @return true if the value was staged, false if it was stale.
+     */
+    bool publish(const String& key, const var& newValue, int64 version)
+    {
+        String newValueStr = newValue.toString();
+        {
+            ScopedLock sl(pendingLock);
+            if( publishedVersions.contains(key) && publishedVersions[key] >= version )
+                return false;
+            
+            publishedVersions.set(key, version);
+            pendingRemovals.removeString(key);
+            pendingValues.set(key, newValueStr);
+        }
+        
+        flushThread.notify();
+        return true;
+    }
+    
+    /**
+     removes a key from the settings file.
+     
+     The removal gets a version of its own, like any other write, so a value for this key
+     that was snapshotted before the removal but published after it is dropped as stale,
+     instead of bringing the key back.
+     */
+    void removeKey(const String& key)
+    {
+        {
+            ScopedLock sl(pendingLock);
+            publishedVersions.set(key, nextVersion());
+            pendingValues.remove(key);
+            pendingRemovals.addIfNotAlreadyThere(key);
+        }
+        
+        flushThread.notify();
+    }
+    
+    /**
+     applies every staged change to the settings file and writes it to disk, if anything
+     actually changed.  The flush thread calls this after each publish(), but you can call it
+     yourself when you need everything to be on disk right now.
+     */
+    void flush()
+    {
+        ScopedLock fl(fileLock);
+        StringPairArray values(false);
+        StringArray removals;
+        {
+            ScopedLock sl(pendingLock);
+            values = pendingValues;
+            removals = pendingRemovals;
+            pendingValues.clear();
+            pendingRemovals.clear();
+        }
+        
+        auto* settings = appProperties.getUserSettings();
+        for( auto& key : removals )
+        {
+            if( !settings->containsKey(key) )
+                continue;
+            
+            dirtyKeys.addIfNotAlreadyThere(key);
+            settings->removeValue(key);
+        }
+        
+        auto& keys = values.getAllKeys();
+        auto& strings = values.getAllValues();
+        for( int i = 0; i < keys.size(); ++i )
+        {
+            if( settings->containsKey(keys[i]) && settings->getValue(keys[i]) == strings[i] )
+                continue;
+            
+            dirtyKeys.addIfNotAlreadyThere(keys[i]);
+            settings->setValue(keys[i], strings[i]);
+        }
+        
+        saveIfNeeded();
+    }
+    
+    /**
+     returns the keys whose values or removals have not been written to disk yet.
+     keys that were published with the value already stored for them are not included,
+     as flushing them won't write anything.
+     
+     publish() stages a change before it returns, so this includes every write that has
+     returned.  The flush thread may write them at any moment though, so a key can stop
+     being dirty right after this returns.
+     */
+    StringArray getDirtyKeys()
+    {
+        ScopedLock fl(fileLock);
+        ScopedLock sl(pendingLock);
+        auto* settings = appProperties.getUserSettings();
+        
+        //applied to the PropertiesFile, but the save failed
+        StringArray keys(dirtyKeys);
+        
+        auto& pendingKeys = pendingValues.getAllKeys();
+        auto& pendingStrings = pendingValues.getAllValues();
+        for( int i = 0; i < pendingKeys.size(); ++i )
+        {
+            if( !settings->containsKey(pendingKeys[i]) || settings->getValue(pendingKeys[i]) != pendingStrings[i] )
+                keys.addIfNotAlreadyThere(pendingKeys[i]);
+        }
+        
+        for( auto& key : pendingRemovals )
+        {
+            if( settings->containsKey(key) )
+                keys.addIfNotAlreadyThere(key);
+        }
+        
+        return keys;
+    }
+    
+    /**
+     returns the size in bytes of the settings file that the next flush would write,
+     or 0 if nothing is dirty and the next flush won't write anything.
+     a save always rewrites the whole file, so this is the size of all of the settings,
+     not just the dirty ones.
+     
+     like getDirtyKeys(), this races with the flush thread: it is a snapshot of what is
+     still waiting to be written at the moment it's called.
+     */
+    int64 getPendingWriteSize()
+    {
+        if( getDirtyKeys().isEmpty() )
+            return 0;
+        
+        ScopedLock fl(fileLock);
+        StringPairArray merged(appProperties.getUserSettings()->getAllProperties());
+        {
+            ScopedLock sl(pendingLock);
+            for( auto& key : pendingRemovals )
+            {
+                merged.remove(key);
+            }
+            auto& pendingKeys = pendingValues.getAllKeys();
+            auto& pendingStrings = pendingValues.getAllValues();
+            for( int i = 0; i < pendingKeys.size(); ++i )
+            {
+                merged.set(pendingKeys[i], pendingStrings[i]);
+            }
+        }
+        
+        return getSerializedSize(merged, appProperties.getStorageParameters().storageFormat);
+    }
+    
+    /**
+     returns how many times the settings file has actually been written to disk.
+     
+     Writes are staged and saved later by the flush thread, so this flushes first: the
+     count then includes any write caused by everything published so far.  Compare it
+     before and after a teardown to confirm that the teardown wrote nothing.
+     */
+    int getNumFileWrites()
+    {
+        flush();
+        return numFileWrites.get();
+    }
+    
+    /**
+     reads a key, including any change that has been published but not flushed yet.
+     */
+    String getValue(const String& key, const String& defaultValue)
+    {
+        {
+            ScopedLock sl(pendingLock);
+            if( pendingRemovals.contains(key) )
+                return defaultValue;
+            
+            if( pendingValues.getAllKeys().contains(key) )
+                return pendingValues[key];
+        }
+        
+        ScopedLock sl(fileLock);
+        return appProperties.getUserSettings()->getValue(key, defaultValue);
+    }
 private:
+    static File& getSettingsFileOverride()
+    {
+        static File file;
+        return file;
+    }
+    
+    struct FlushThread : public Thread
+    {
+        FlushThread(PropertyManager& o) : Thread("PropertyManager flush"), owner(o) {}
+        
+        void run() override
+        {
+            while( !threadShouldExit() )
+            {
+                //anything published while we're flushing re-signals us, so it gets picked up in the next pass
+                wait(-1);
+                owner.flush();
+            }
+        }
+        
+        PropertyManager& owner;
+    };
+    
+    ///checks the magic number that PropertiesFile writes at the start of binary files
+    static bool isStoredAs(const File& file, PropertiesFile::StorageFormat format)
+    {
+        FileInputStream in(file);
+        const int magic = in.openedOk() ? in.readInt() : 0;
+        const int binaryMagic = (int) ByteOrder::littleEndianInt("PROP");
+        const int compressedMagic = (int) ByteOrder::littleEndianInt("CPRP");
+        
+        if( format == PropertiesFile::storeAsCompressedBinary )
+            return magic == compressedMagic;
+        if( format == PropertiesFile::storeAsBinary )
+            return magic == binaryMagic;
+        return magic != binaryMagic && magic != compressedMagic;
+    }
+    
+    /**
+     returns the size that a settings file with these properties has on disk.
+     this mirrors how PropertiesFile::saveAsXml() and saveAsBinary() write the file, except that
+     values that are themselves XML are counted as an attribute rather than as a child element.
+     */
+    static int64 getSerializedSize(const StringPairArray& props, PropertiesFile::StorageFormat format)
+    {
+        auto& keys = props.getAllKeys();
+        auto& values = props.getAllValues();
+        MemoryOutputStream out;
+        
+        if( format == PropertiesFile::storeAsXML )
+        {
+            XmlElement doc("PROPERTIES");
+            for( int i = 0; i < keys.size(); ++i )
+            {
+                auto* e = doc.createNewChildElement("VALUE");
+                e->setAttribute("name", keys[i]);
+                e->setAttribute("val", values[i]);
+            }
+            doc.writeToStream(out, String());
+            return (int64) out.getDataSize();
+        }
+        
+        out.writeInt(0); //the magic number
+        OutputStream* stream = &out;
+        ScopedPointer<GZIPCompressorOutputStream> gzip;
+        if( format == PropertiesFile::storeAsCompressedBinary )
+        {
+            gzip = new GZIPCompressorOutputStream(&out, 9, false);
+            stream = gzip;
+        }
+        
+        stream->writeInt(keys.size());
+        for( int i = 0; i < keys.size(); ++i )
+        {
+            stream->writeString(keys[i]);
+            stream->writeString(values[i]);
+        }
+        
+        gzip = nullptr; //flushes the compressor into out
+        return (int64) out.getDataSize();
+    }
+    
+    ///must be called while holding fileLock
+    void saveIfNeeded()
+    {
+        if( !appProperties.getUserSettings()->needsToBeSaved() )
+            return;
+        
+        //a batched save can cover several keys, so they're all listed on the span
+        PropertyTrace::Span span("ApplicationProperties::saveIfNeeded",
+                                 PropertyTrace::getInstance().isEnabled() ? dirtyKeys.joinIntoString(",") : String());
+        if( appProperties.saveIfNeeded() )
+        {
+            ++numFileWrites;
+            dirtyKeys.clear();
+        }
+    }
+    
     ApplicationProperties appProperties;
     Array<Property*> properties;
     CriticalSection propertyLock;
     
+    ///guards the settings file and dirtyKeys.  always acquired after propertyLock, and before pendingLock.
+    CriticalSection fileLock;
+    ///keys that have been applied to the PropertiesFile but not saved to disk yet
+    StringArray dirtyKeys;
+    Atomic<int> numFileWrites;
+    
+    ///guards the changes that have been published but not flushed yet.  only ever held briefly.
+    CriticalSection pendingLock;
+    HashMap<String, int64> publishedVersions;
+    StringPairArray pendingValues{false};
+    StringArray pendingRemovals;
+    Atomic<int64> versionCounter;
+    
+    static constexpr int numValueLocks = 64;
+    CriticalSection valueLocks[numValueLocks];
+    
+    FlushThread flushThread{*this};
+    
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PropertyManager)
 };
 
@@ -96,6 +488,19 @@ private:
  write the changed value to a properties file automatically every time the value changes.
  restore a value from the properties file the first time a ScopedValueSaver is created with
  a keyName that exists in the properties file
+ 
+ Savers can be written to from any thread.  Every write snapshots the value together with
+ a version number from the PropertyManager, and the PropertyManager only keeps the newest
+ version of each key, so concurrent writers resolve to last-writer-wins.
+ 
+ These are safe to call from any thread: assignment, save(), resetToDefault(), setKeyName(),
+ setChangeCallback(), comparison, and conversion to var or Type.
+ A follower and the saver it follows refer to the same ValueSource, so they share one lock.
+ 
+ These are NOT guarded, and may only be used on the message thread: the Value returned by
+ operator Value(), the Value& passed to the change callback, and the reference returned by
+ getActualValue() unless you hold getLock() while you use it.
+ Constructing or destroying a saver off the message thread takes the MessageManagerLock.
  */
 template<typename Type>
 struct ScopedValueSaver : public Value::Listener, public PropertyManager::Property
@@ -134,8 +539,17 @@ struct ScopedValueSaver : public Value::Listener, public PropertyManager::Proper
     {
         DBG( "ScopedValueSaver FOLLOW Ctor" );
         setup();
-        value.referTo(valueToFollow);
-        updateActualValue();
+        //referTo() moves our listener to another ValueSource, so it needs the message thread too
+        withMessageManagerLock([this, &valueToFollow]
+                               {
+                                   value.referTo(valueToFollow);
+                                   //share a lock with every other saver that refers to this source
+                                   valueLock = &props->getValueLock(value.getValueSource());
+                               });
+        {
+            ScopedLock sl(getLock());
+            updateActualValue();
+        }
         updatePropertiesFile(); //create an entry in Properties as soon as we exist
     }
     
@@ -144,9 +558,14 @@ struct ScopedValueSaver : public Value::Listener, public PropertyManager::Proper
     {
         DBG( "ScopedValueSaver COPY Ctor" );
         setup();
-        value = other.value.getValue();
-        updateActualValue();
-        changeCallback = other.changeCallback;
+        auto otherValue = other.getValueSnapshot();
+        auto otherCallback = other.getChangeCallback();
+        {
+            ScopedLock sl(getLock());
+            value = otherValue;
+            updateActualValue();
+            changeCallback = std::move(otherCallback);
+        }
         /*
          normally, the assignment above would trigger the valueChanged() callback
          but sometimes it doesn't, like if you're using this class before the
@@ -162,9 +581,14 @@ struct ScopedValueSaver : public Value::Listener, public PropertyManager::Proper
     {
         DBG( "ScopedValueSaver operator= (const ScopedValueSaver& )" );
         setup();
-        value = other.value.getValue();
-        updateActualValue();
-        changeCallback = other.changeCallback;
+        auto otherValue = other.getValueSnapshot();
+        auto otherCallback = other.getChangeCallback();
+        {
+            ScopedLock sl(getLock());
+            value = otherValue;
+            updateActualValue();
+            changeCallback = std::move(otherCallback);
+        }
         updatePropertiesFile();
         return *this;
     }
@@ -181,8 +605,11 @@ struct ScopedValueSaver : public Value::Listener, public PropertyManager::Proper
     {
         DBG( "ScopedValueSaver operator=( const OtherType& )" );
         //value.addListener(this); //value already had the listener added!
-        value = VariantConverter<OtherType>::toVar(other);
-        updateActualValue();
+        {
+            ScopedLock sl(getLock());
+            value = VariantConverter<OtherType>::toVar(other);
+            updateActualValue();
+        }
         
         updatePropertiesFile();
         return *this;
@@ -190,27 +617,41 @@ struct ScopedValueSaver : public Value::Listener, public PropertyManager::Proper
     
     ~ScopedValueSaver()
     {
-        value.removeListener(this);
+        //stop resetAllToDefault() from reaching us while we're being destroyed
+        props->removeProperty(this);
+        withMessageManagerLock([this] { value.removeListener(this); });
         updatePropertiesFile();
     }
     
     void valueChanged(Value& changedVal) override
     {
-        if( changedVal == value )
+        std::function<void(Value&)> callback;
+        String key;
         {
-            DBG( "value changed" );
+            ScopedLock sl(getLock());
+            if( !(changedVal.getValue() == value.getValue()) )
+                return;
+            
+            callback = changeCallback;
+            key = keyName;
+        }
+        
+        PropertyTrace::Span span("ScopedValueSaver::valueChanged", key);
+        DBG( "value changed" );
+        {
+            ScopedLock sl(getLock());
             updateActualValue();
-            updatePropertiesFile();
-            //            props->dump("post-update");
-            if( changeCallback )
-            {
-                changeCallback(value);
-            }
+        }
+        updatePropertiesFile();
+        //            props->dump("post-update");
+        if( callback )
+        {
+            callback(value);
         }
     }
     
-    bool operator== (const ScopedValueSaver& other) const noexcept { return value == other.value; }
-    bool operator!= (const ScopedValueSaver& other) const noexcept { return !(value == other.value); }
+    bool operator== (const ScopedValueSaver& other) const noexcept { return getValueSnapshot() == other.getValueSnapshot(); }
+    bool operator!= (const ScopedValueSaver& other) const noexcept { return !(*this == other); }
     
     /**
      Allows this object to behave like a juce::var.
@@ -221,7 +662,7 @@ struct ScopedValueSaver : public Value::Listener, public PropertyManager::Proper
      
      @return a juce::var version of Type.
      */
-    operator var() const noexcept { return value.getValue(); }
+    operator var() const noexcept { return getValueSnapshot(); }
     
     /**
      Allows this object to behave like a juce::Value
@@ -229,6 +670,9 @@ struct ScopedValueSaver : public Value::Listener, public PropertyManager::Proper
      this is called by static_cast<Value>( ScopedValueSaver<Type>() );
      or T::foo(const Value& v) e.g. T t; t.foo( scopedValueState );
      
+     The returned Value shares this saver's ValueSource, but isn't guarded by getLock(),
+     so only use it on the message thread.
+     
      @return a juce::Value version of Type
      */
     operator Value() const noexcept { return value; }
@@ -242,12 +686,13 @@ struct ScopedValueSaver : public Value::Listener, public PropertyManager::Proper
      */
     operator Type() const noexcept
     {
-        return VariantConverter<Type>::fromVar(value.getValue());
+        return VariantConverter<Type>::fromVar(getValueSnapshot());
     }
     
     ///changes the callback that will be executed when the internal juce::Value is modified
     void setChangeCallback(std::function<void(Value&)> callback)
     {
+        ScopedLock sl(getLock());
         changeCallback = std::move(callback);
     }
     
@@ -258,8 +703,11 @@ struct ScopedValueSaver : public Value::Listener, public PropertyManager::Proper
      */
     void setKeyName(StringRef name)
     {
-        props->getProperties().getUserSettings()->removeValue(keyName);
-        keyName = name;
+        {
+            ScopedLock sl(getLock());
+            props->removeKey(keyName);
+            keyName = name;
+        }
         updatePropertiesFile();
     }
     
@@ -268,8 +716,11 @@ struct ScopedValueSaver : public Value::Listener, public PropertyManager::Proper
      */
     void resetToDefault() override
     {
-        value = VariantConverter<Type>::toVar( defaultValue );
-        actualValue = defaultValue;
+        {
+            ScopedLock sl(getLock());
+            value = VariantConverter<Type>::toVar( defaultValue );
+            actualValue = defaultValue;
+        }
         updatePropertiesFile();
     }
     
@@ -278,9 +729,13 @@ struct ScopedValueSaver : public Value::Listener, public PropertyManager::Proper
      Be advised that this does not automatically save if you modify a member variable.
      for this reason, save() is provided as a way to manually save your value to disk
      after modifying a member of it.
+     If other threads write to this saver, hold getLock() while you use the returned reference.
      */
     Type& getActualValue() { return actualValue; }
     
+    ///the lock that guards the internal value and actualValue.  shared by all savers that refer to the same ValueSource
+    const CriticalSection& getLock() const noexcept { return *valueLock; }
+    
     /**
      updates the internal juce::Value object to match the value of actualValue.
      this is typically called after using getActualValue() to modify members of Type.
@@ -288,36 +743,95 @@ struct ScopedValueSaver : public Value::Listener, public PropertyManager::Proper
      */
     void save()
     {
-        value.removeListener(this);
-        value = VariantConverter<Type>::toVar( actualValue );
-        value.addListener(this);
+        {
+            ScopedLock sl(getLock());
+            /*
+             the listener stays attached (removing it isn't safe off the message thread), so
+             the change callback fires for this change, just as it did when the listener was
+             re-added before the async notification arrived.
+             */
+            value = VariantConverter<Type>::toVar( actualValue );
+        }
         updatePropertiesFile();
     }
 private:
     void setup()
     {
+        valueLock = &props->getValueLock(value.getValueSource());
         props->addProperty(this);
-        value.addListener(this);
+        withMessageManagerLock([this] { value.addListener(this); });
     }
     
+    /**
+     Value's listener lists are walked on the message thread without any lock,
+     so they may only be changed on the message thread, or while holding the MessageManagerLock.
+     */
+    template<typename Callback>
+    static void withMessageManagerLock(Callback&& callback)
+    {
+        auto* mm = MessageManager::getInstanceWithoutCreating();
+        if( mm == nullptr || mm->isThisTheMessageThread() )
+        {
+            callback();
+            return;
+        }
+        
+        /*
+         the lock is only refused when this thread has been asked to stop.  whoever asked is then
+         normally waiting for us on the message thread, so nothing is being dispatched, and
+         blocking here would deadlock with them.
+         */
+        const MessageManagerLock mmLock(Thread::getCurrentThread());
+        callback();
+    }
+    
+    std::function<void(Value&)> getChangeCallback() const
+    {
+        ScopedLock sl(getLock());
+        return changeCallback;
+    }
+    
+    ///must be called while holding valueLock
     void updateActualValue()
     {
         actualValue = VariantConverter<Type>::fromVar(value.getValue());
     }
     
+    var getValueSnapshot() const
+    {
+        ScopedLock sl(getLock());
+        return value.getValue();
+    }
+    
     void updatePropertiesFile()
     {
-        if( keyName.isNotEmpty() )
+        /*
+         the value and its version are captured together under valueLock, so that
+         the version order matches the order the values were written in.
+         the actual file write happens outside of valueLock. if another thread publishes
+         a newer version first, our older one is simply dropped by the PropertyManager.
+         */
+        String key;
+        var snapshot;
+        int64 version = 0;
         {
-            DBG( "updating properties with changed value for: " << keyName );
-            props->getProperties().getUserSettings()->setValue(keyName,
-                                                               value);
-            props->getProperties().saveIfNeeded();
+            ScopedLock sl(getLock());
+            if( keyName.isEmpty() )
+                return;
+            
+            key = keyName;
+            snapshot = value.getValue();
+            version = props->nextVersion();
         }
+        
+        PropertyTrace::Span span("ScopedValueSaver::updatePropertiesFile", key);
+        DBG( "updating properties with changed value for: " << key );
+        props->publish(key, snapshot, version);
     }
     
     void restore(const Type& initialValue)
     {
+        PropertyTrace::Span span("ScopedValueSaver::restore", keyName);
         /*
          the properties are stored as Strings
          the initialValue is not a string, so it must be converted to a string representation
@@ -334,16 +848,18 @@ private:
          */
         String defaultValStr = VariantConverter<Type>::toVar(initialValue).toString();
         
-        String propStrVal = props->getProperties().getUserSettings()->getValue(keyName,
-                                                                               defaultValStr);
+        String propStrVal = props->getValue(keyName, defaultValStr);
         var tempVar = VariantConverter<String>::toVar(propStrVal);
         
         Type tempType = VariantConverter<Type>::fromVar(tempVar);
         
         var properVar = VariantConverter<Type>::toVar(tempType);
         
-        value = properVar;
-        updateActualValue();
+        {
+            ScopedLock sl(getLock());
+            value = properVar;
+            updateActualValue();
+        }
         updatePropertiesFile();
     }
     
@@ -372,6 +888,9 @@ private:
     
     Type actualValue{};
     
+    ///guards value, actualValue, keyName and changeCallback against concurrent writers.  set by setup()
+    const CriticalSection* valueLock = nullptr;
+    
     JUCE_LEAK_DETECTOR(ScopedValueSaver)
 };
 